@@ -31,6 +31,7 @@
 #include <io.h>			// ...
 #include <cstdio>		// C IO.
 #include <cstdlib>		// C Standard General Utilities Library.
+#include <malloc.h>		// Heap block sizes.
 #include <cstddef>		// C Standard definitions.
 #include <ctime>		// C Time Library.
 #include <cfloat>		// Characteristics of floating-point types.
@@ -52,6 +53,7 @@
 #include <algorithm>	// Standard Template Library: Algorithms.
 #include <exception>	// Standard exception class.
 #include <functional>	// Function objects.
+#include <new>			// Allocation operators.
 #include <string>		// C++ Strings library.
 
 // Input/Output.
@@ -6,10 +6,24 @@
 typedef std::map<std::string, int> StatisticPair;
 typedef std::map<std::string, StatisticPair> StatisticMap;
 
-typedef std::pair<int, std::string> ToplistPair;
+// Toplist entries refer to characters by their index in the name table.
+typedef std::vector<std::string> NameVec;
+typedef std::pair<int, unsigned long> ToplistPair;
 typedef std::vector<ToplistPair> ToplistVec;
 typedef std::map<std::string, ToplistVec> ToplistMap;
 
+// Orders toplist entries by value, then by character name.
+struct ToplistLess {
+	const NameVec* Names;
+
+	ToplistLess( const NameVec &i_Names ) : Names( &i_Names ) {}
+
+	bool operator()( const ToplistPair &a, const ToplistPair &b ) const {
+		if ( a.first != b.first ) return a.first < b.first;
+		return (*Names)[a.second] < (*Names)[b.second];
+	}
+};
+
 typedef std::vector<std::string> WarningVect;
 
 class StatisticsWriter {
@@ -23,6 +37,7 @@ public:
 	int Format;
 	unsigned long CountedBics;
 	unsigned long IgnoredBics;
+	NameVec Names;
 
 	std::map<std::string, bool> WriteQuery;
 
@@ -33,7 +48,31 @@ public:
 		ToplistMax = 10;
 	}
 
-	void LogWarning( std::string i_Warning ) {
+	unsigned long AddName( std::string i_Name ) {
+		Names.push_back( std::string() );
+		Names.back().swap( i_Name );
+		return (unsigned long)( Names.size() - 1 );
+	}
+
+	// Drops names no toplist refers to anymore, renumbering the rest.
+	void CompactNames( ToplistMap &i_Toplists ) {
+		std::vector<unsigned long> Remap( Names.size(), ULONG_MAX );
+		NameVec Kept;
+		for ( ToplistMap::iterator t = i_Toplists.begin(); t != i_Toplists.end(); t++ ) {
+			for ( ToplistVec::iterator i = t->second.begin(); i < t->second.end(); i++ ) {
+				unsigned long &Index = Remap[i->second];
+				if ( Index == ULONG_MAX ) {
+					Index = (unsigned long)Kept.size();
+					Kept.push_back( std::string() );
+					Kept.back().swap( Names[i->second] );
+				}
+				i->second = Index;
+			}
+		}
+		Names.swap( Kept );
+	}
+
+	void LogWarning( const std::string &i_Warning ) {
 		m_Warnings.push_back( i_Warning );
 	}
 
@@ -112,8 +151,8 @@ public:
 		}
 		
 		// Sort the toplist.
-		if ( !i_ReverseSort ) std::sort( i_Toplist.rbegin(), i_Toplist.rend() );
-		else std::sort( i_Toplist.begin(), i_Toplist.end() );
+		if ( !i_ReverseSort ) std::sort( i_Toplist.rbegin(), i_Toplist.rend(), ToplistLess( Names ) );
+		else std::sort( i_Toplist.begin(), i_Toplist.end(), ToplistLess( Names ) );
 
 		// Write the toplist.
 		if ( Format == 1 ) m_Log << boost::format( OutputHead ) % i_Header % i_Header;
@@ -122,7 +161,7 @@ public:
 		for ( ToplistVec::iterator i = i_Toplist.begin(); i < i_Toplist.end(); i++ ) {
 			if ( c > ToplistMax ) break;
 			if ( i->first == 0 ) continue;
-			m_Log << boost::format( OutputRow ) % i->first % i->second;
+			m_Log << boost::format( OutputRow ) % i->first % Names[i->second];
 			c++;
 		}
 		m_Log << OutputFooter;
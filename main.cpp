@@ -1,6 +1,60 @@
 #include "Precomp.h"
 #include "StatisticsWriter.h"
 
+// Heap accounting. Every operator new/delete in the program goes through these,
+// including FoamUtils' GFF buffers. The scan is single-threaded, so the
+// counters are plain integers.
+static long long g_HeapLive = 0;
+static long long g_HeapPeak = 0;
+
+static void* HeapAllocate( size_t i_Size ) {
+	void* p = malloc( i_Size ? i_Size : 1 );
+	if ( p == NULL ) return NULL;
+	g_HeapLive += _msize( p );
+	if ( g_HeapLive > g_HeapPeak ) g_HeapPeak = g_HeapLive;
+	return p;
+}
+
+static void HeapFree( void* p ) {
+	if ( p == NULL ) return;
+	g_HeapLive -= _msize( p );
+	free( p );
+}
+
+void* operator new( size_t i_Size ) {
+	void* p = HeapAllocate( i_Size );
+	if ( p == NULL ) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[]( size_t i_Size ) {
+	return operator new( i_Size );
+}
+
+void* operator new( size_t i_Size, const std::nothrow_t& ) throw() {
+	return HeapAllocate( i_Size );
+}
+
+void* operator new[]( size_t i_Size, const std::nothrow_t& ) throw() {
+	return HeapAllocate( i_Size );
+}
+
+void operator delete( void* p ) throw() {
+	HeapFree( p );
+}
+
+void operator delete[]( void* p ) throw() {
+	HeapFree( p );
+}
+
+void operator delete( void* p, const std::nothrow_t& ) throw() {
+	HeapFree( p );
+}
+
+void operator delete[]( void* p, const std::nothrow_t& ) throw() {
+	HeapFree( p );
+}
+
 // Data types for surfing cached 2DA data.
 typedef std::pair<unsigned long, std::string> StringIndex;
 typedef std::vector<StringIndex> Index2DA;
@@ -241,6 +295,40 @@ int main( int argc, char** argv ) {
 		Index2DA Wings = GetStringRefArray2DA( resources, "wingmodel", "StringRef" );
 		for ( Index2DA::iterator i = Wings.begin(); i < Wings.end(); i++ ) Statistics["wings"][i->second] = 0;
 		
+		// Flags checked for every character, looked up once.
+		const bool ShowGender = showSettings["gender"];
+		const bool ShowRace = showSettings["race"];
+		const bool ShowSubrace = showSettings["subrace"];
+		const bool ShowBackground = showSettings["background"];
+		const bool ShowDeity = showSettings["deity"];
+		const bool ShowAlignment = showSettings["alignment"];
+		const bool ShowTails = showSettings["tails"];
+		const bool ShowWings = showSettings["wings"];
+		const bool ShowLevels = showSettings["levels"];
+		const bool ShowSkills = showSettings["skills"] || showSettings["top-skills"];
+		const bool ShowFeats = showSettings["feats"];
+		const bool TopHealth = showSettings["top-health"];
+		const bool TopArmorClass = showSettings["top-armorclass"];
+		const bool TopBaseAttackBonus = showSettings["top-baseattackbonus"];
+		const bool TopAbilities = showSettings["top-abilities"];
+		const bool TopSaves = showSettings["top-saves"];
+		const bool TopWealth = showSettings["top-wealth"];
+		const bool TopExperience = showSettings["top-experience"];
+		const bool TopAge = showSettings["top-youngest"] || showSettings["top-oldest"];
+		const bool TopItemCount = showSettings["top-itemcount"];
+		const bool TopFileSize = showSettings["top-filesize"];
+		const bool KeepNames = ShowSkills || TopHealth || TopArmorClass || TopBaseAttackBonus || TopAbilities || TopSaves || TopWealth || TopExperience || TopAge || TopItemCount || TopFileSize;
+
+		// Skill toplists, keyed once on the first counted character.
+		std::vector<ToplistVec*> SkillToplists;
+
+		// Warning text, reused between files.
+		std::string Warning;
+
+		// Peak heap bytes held while scanning each counted character.
+		long long HeapCharacterPeak = 0;
+		double HeapCharacterTotal = 0;
+
 		// Get the bic file data.
 		TextOut.WriteText( "\nGathering character data ..." );
 		typedef std::vector<boost::filesystem::path> PathVec;
@@ -254,12 +342,11 @@ int main( int argc, char** argv ) {
 				uintmax_t filesize = boost::filesystem::file_size( *c );
 				if ( filesize == 0 ) {
 					// Compile string.
-					std::stringstream ss;
-					ss << "Zero-size file: ";
-					ss << *c;
+					Warning.assign( "Zero-size file: " );
+					Warning.append( c->string() );
 
 					// Log the warning.
-					writer.LogWarning( ss.str() );
+					writer.LogWarning( Warning );
 
 					// Skip file.
 					continue;
@@ -269,95 +356,112 @@ int main( int argc, char** argv ) {
 				try {
 					// Load b data.
 					if ( c->extension() != ".bic" ) continue;
-					CharacterBic* b = new CharacterBic( resources, c->string() );
-					b->player = c->parent_path().filename().string();
-					b->filesize = boost::filesystem::file_size( *c );
-					b->lastmodified = boost::filesystem::last_write_time( *c );
+					long long HeapBefore = g_HeapLive;
+					g_HeapPeak = HeapBefore;
+					CharacterBic b( resources, c->string() );
+					b.player = c->parent_path().filename().string();
+					b.filesize = filesize;
+					b.lastmodified = boost::filesystem::last_write_time( *c );
 				
 					// Ignore if it's past the cutoff date.
 					if ( cutofftime != 0 ) {
-						double timedif = difftime( now, b->lastmodified );
+						double timedif = difftime( now, b.lastmodified );
 						if ( timedif > cutofftime ) {
 							writer.IgnoredBics++;
-							delete b;
 							continue;
 						}
 					}
 				
 					// Update easy statistics.
-					std::string Name = b->GetFullName();
-					if ( showSettings["gender"] ) Statistics["gender"][b->GetGffToString( "Gender", "gender", "GENDER" )]++;
-					if ( showSettings["race"] ) Statistics["race"][b->GetGffToTlkString( "Race", "racialtypes", "Name" )]++;
-					if ( showSettings["subrace"] ) Statistics["subrace"][b->GetGffToTlkString( "Subrace", "racialsubtypes", "Name" )]++;
-					if ( showSettings["background"] ) Statistics["background"][b->GetGffToTlkString( "CharBackground", "backgrounds", "Name" )]++;
-					if ( showSettings["deity"] ) Statistics["deity"][b->GetString( "Deity" )]++;
-					if ( showSettings["alignment"] ) Statistics["alignment"][b->GetAlignment()]++;
-					if ( showSettings["tails"] ) Statistics["tails"][b->GetGffToTlkString( "Tail", "tailmodel", "StringRef" )]++;
-					if ( showSettings["wings"] ) Statistics["wings"][b->GetGffToTlkString( "Wings", "wingmodel", "StringRef" )]++;
+					unsigned long Name = KeepNames ? writer.AddName( b.GetFullName() ) : 0;
+					if ( ShowGender ) Statistics["gender"][b.GetGffToString( "Gender", "gender", "GENDER" )]++;
+					if ( ShowRace ) Statistics["race"][b.GetGffToTlkString( "Race", "racialtypes", "Name" )]++;
+					if ( ShowSubrace ) Statistics["subrace"][b.GetGffToTlkString( "Subrace", "racialsubtypes", "Name" )]++;
+					if ( ShowBackground ) Statistics["background"][b.GetGffToTlkString( "CharBackground", "backgrounds", "Name" )]++;
+					if ( ShowDeity ) Statistics["deity"][b.GetString( "Deity" )]++;
+					if ( ShowAlignment ) Statistics["alignment"][b.GetAlignment()]++;
+					if ( ShowTails ) Statistics["tails"][b.GetGffToTlkString( "Tail", "tailmodel", "StringRef" )]++;
+					if ( ShowWings ) Statistics["wings"][b.GetGffToTlkString( "Wings", "wingmodel", "StringRef" )]++;
 
 					// Update class levels.
-					if ( showSettings["levels"] ) {
+					if ( ShowLevels ) {
+						StatisticPair &Levels = Statistics["levels"];
 						for ( Index2DA::iterator c = Classes.begin(); c < Classes.end(); c++ )
-							Statistics["levels"][c->second] += b->GetClassLevels( c->first );
+							Levels[c->second] += b.GetClassLevels( c->first );
 					}
 
 					// Update skill data.
-					if ( showSettings["skills"] || showSettings["top-skills"] ) {
-						for ( Index2DA::iterator s = Skills.begin(); s < Skills.end(); s++ ) {
-							int ranks = b->GetSkillRanks( s->first );
-							Statistics["skills"][s->second] += ranks;
-							Toplists["Skill: " + s->second].push_back( ToplistPair( ranks, Name ) );
+					if ( ShowSkills ) {
+						StatisticPair &SkillRanks = Statistics["skills"];
+						if ( SkillToplists.empty() ) {
+							for ( Index2DA::iterator s = Skills.begin(); s < Skills.end(); s++ )
+								SkillToplists.push_back( &Toplists["Skill: " + s->second] );
+						}
+						for ( size_t s = 0; s < Skills.size(); s++ ) {
+							int ranks = b.GetSkillRanks( Skills[s].first );
+							SkillRanks[Skills[s].second] += ranks;
+							SkillToplists[s]->push_back( ToplistPair( ranks, Name ) );
 						}
 					}
 
 					// Update feat data.
-					if ( showSettings["feats"] ) {
+					if ( ShowFeats ) {
+						StatisticPair &FeatCounts = Statistics["feats"];
 						for ( Index2DA::iterator s = Feats.begin(); s < Feats.end(); s++ ) {
-							if ( b->GetHasFeat( s->first ) ) Statistics["feats"][s->second]++;
+							if ( b.GetHasFeat( s->first ) ) FeatCounts[s->second]++;
 						}
 					}
 
 					// Update toplists.
-					if ( showSettings["top-health"] ) Toplists["health"].push_back( ToplistPair( b->GetIntUnsigned( "HitPoints" ), Name ) );
-					if ( showSettings["top-armorclass"] ) Toplists["armorclass"].push_back( ToplistPair( b->GetIntUnsigned( "ArmorClass" ), Name ) );
-					if ( showSettings["top-baseattackbonus"] ) Toplists["baseattackbonus"].push_back( ToplistPair( b->GetIntUnsigned( "BaseAttackBonus" ), Name ) );
-					if ( showSettings["top-abilities"] ) Toplists["strength"].push_back( ToplistPair( b->GetIntUnsigned( "Str" ), Name ) );
-					if ( showSettings["top-abilities"] ) Toplists["dexterity"].push_back( ToplistPair( b->GetIntUnsigned( "Dex" ), Name ) );
-					if ( showSettings["top-abilities"] ) Toplists["constitution"].push_back( ToplistPair( b->GetIntUnsigned( "Con" ), Name ) );
-					if ( showSettings["top-abilities"] ) Toplists["intelligence"].push_back( ToplistPair( b->GetIntUnsigned( "Int" ), Name ) );
-					if ( showSettings["top-abilities"] ) Toplists["wisdom"].push_back( ToplistPair( b->GetIntUnsigned( "Wis" ), Name ) );
-					if ( showSettings["top-abilities"] ) Toplists["charisma"].push_back( ToplistPair( b->GetIntUnsigned( "Cha" ), Name ) );
-					if ( showSettings["top-saves"] ) Toplists["save-fort"].push_back( ToplistPair( b->GetInt( "FortSaveThrow" ), Name ) );
-					if ( showSettings["top-saves"] ) Toplists["save-refl"].push_back( ToplistPair( b->GetInt( "RefSaveThrow" ), Name ) );
-					if ( showSettings["top-saves"] ) Toplists["save-will"].push_back( ToplistPair( b->GetInt( "WillSaveThrow" ), Name ) );
-					if ( showSettings["top-wealth"] ) Toplists["gold"].push_back( ToplistPair( b->GetIntUnsigned( "Gold" ), Name ) );
-					if ( showSettings["top-experience"] ) Toplists["experience"].push_back( ToplistPair( b->GetIntUnsigned( "Experience" ), Name ) );
-					if ( showSettings["top-youngest"] || showSettings["top-oldest"] ) Toplists["age"].push_back( ToplistPair( b->GetIntUnsigned( "Age" ), Name ) );
-					if ( showSettings["top-itemcount"] ) Toplists["itemcount"].push_back( ToplistPair( b->GetInventorySize(), Name ) );
-					if ( showSettings["top-filesize"] ) Toplists["filesize"].push_back( ToplistPair( b->filesize, Name ) );
-
-					delete b;
+					if ( TopHealth ) Toplists["health"].push_back( ToplistPair( b.GetIntUnsigned( "HitPoints" ), Name ) );
+					if ( TopArmorClass ) Toplists["armorclass"].push_back( ToplistPair( b.GetIntUnsigned( "ArmorClass" ), Name ) );
+					if ( TopBaseAttackBonus ) Toplists["baseattackbonus"].push_back( ToplistPair( b.GetIntUnsigned( "BaseAttackBonus" ), Name ) );
+					if ( TopAbilities ) Toplists["strength"].push_back( ToplistPair( b.GetIntUnsigned( "Str" ), Name ) );
+					if ( TopAbilities ) Toplists["dexterity"].push_back( ToplistPair( b.GetIntUnsigned( "Dex" ), Name ) );
+					if ( TopAbilities ) Toplists["constitution"].push_back( ToplistPair( b.GetIntUnsigned( "Con" ), Name ) );
+					if ( TopAbilities ) Toplists["intelligence"].push_back( ToplistPair( b.GetIntUnsigned( "Int" ), Name ) );
+					if ( TopAbilities ) Toplists["wisdom"].push_back( ToplistPair( b.GetIntUnsigned( "Wis" ), Name ) );
+					if ( TopAbilities ) Toplists["charisma"].push_back( ToplistPair( b.GetIntUnsigned( "Cha" ), Name ) );
+					if ( TopSaves ) Toplists["save-fort"].push_back( ToplistPair( b.GetInt( "FortSaveThrow" ), Name ) );
+					if ( TopSaves ) Toplists["save-refl"].push_back( ToplistPair( b.GetInt( "RefSaveThrow" ), Name ) );
+					if ( TopSaves ) Toplists["save-will"].push_back( ToplistPair( b.GetInt( "WillSaveThrow" ), Name ) );
+					if ( TopWealth ) Toplists["gold"].push_back( ToplistPair( b.GetIntUnsigned( "Gold" ), Name ) );
+					if ( TopExperience ) Toplists["experience"].push_back( ToplistPair( b.GetIntUnsigned( "Experience" ), Name ) );
+					if ( TopAge ) Toplists["age"].push_back( ToplistPair( b.GetIntUnsigned( "Age" ), Name ) );
+					if ( TopItemCount ) Toplists["itemcount"].push_back( ToplistPair( b.GetInventorySize(), Name ) );
+					if ( TopFileSize ) Toplists["filesize"].push_back( ToplistPair( b.filesize, Name ) );
+
+					// Record the heap this character held at its peak.
+					long long HeapUsed = g_HeapPeak - HeapBefore;
+					if ( HeapUsed > HeapCharacterPeak ) HeapCharacterPeak = HeapUsed;
+					HeapCharacterTotal += (double)HeapUsed;
+
 					writer.CountedBics++;
 				} catch ( std::exception &e ) {
 					// Compile string.
-					std::stringstream ss;
-					ss << *c;
-					ss << " : ";
-					ss << e.what();
+					Warning.assign( c->string() );
+					Warning.append( " : " );
+					Warning.append( e.what() );
 
 					// Log the warning.
-					writer.LogWarning( ss.str() );
+					writer.LogWarning( Warning );
 				}
 			}
 
 			// Cut off the toplists after each player.
 			for ( ToplistMap::iterator i = Toplists.begin(); i != Toplists.end(); i++ ) {
 				if ( i->second.size() < ( writer.ToplistMax * 2 + 2 ) ) continue;
-				std::sort( i->second.rbegin(), i->second.rend() );
+				std::sort( i->second.rbegin(), i->second.rend(), ToplistLess( writer.Names ) );
 				i->second.erase( i->second.begin() + writer.ToplistMax + 1, i->second.end() - writer.ToplistMax - 1 );
 			}
+			if ( KeepNames ) writer.CompactNames( Toplists );
 		}
 
+		// Memory usage, on the console only.
+		double HeapCharacterAverage = ( writer.CountedBics > 0 ) ? HeapCharacterTotal / (double)writer.CountedBics : 0;
+		TextOut.WriteText( "\nHeap bytes per counted character: %lu peak, %.0f average.", (unsigned long)HeapCharacterPeak, HeapCharacterAverage );
+		TextOut.WriteText( "\nHeap bytes live after scan: %lu.", (unsigned long)g_HeapLive );
+
 		// Output data.
 		TextOut.WriteText( "\nWriting statistics ..." );
 		writer.WriteStatistics( Statistics );